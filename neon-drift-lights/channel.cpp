@@ -19,6 +19,7 @@
 
 #include "channel.h"
 #include "config.h"
+#include "utils.h"
 
 Channel channels[CH_MAXNUM] = {
   Channel(CH_STEER, PIN_CH_STEER),
@@ -41,26 +42,148 @@ void Channel::save_ep() {
   EEPROM.put(addr, ep);
 }
 
+/**
+ * Update the receiver health statistics with a new pulse.
+ *
+ * Runs in constant time with integer math only, since it is called from the
+ * ISR on every falling edge.
+ *
+ * Returns the pulse width to accept as a reading, or 0 if it is rejected.
+ * Glitches are always rejected, while pulses beyond the endpoints are clamped
+ * to them unless calibrating.
+ */
+static inline uint32_t update_stats(Channel& ch, uint32_t width,
+    uint32_t cur_time) {
+  ChannelStats& st = ch._stats;
+  if (width < PULSE_MIN_WIDTH || width > PULSE_MAX_WIDTH) {
+    st.glitches++;
+    return 0;
+  }
+
+  const uint32_t ep_min = min(ch.ep.l, ch.ep.h);
+  const uint32_t ep_max = max(ch.ep.l, ch.ep.h);
+  if (width + PULSE_EP_TOLERANCE < ep_min ||
+      width > ep_max + PULSE_EP_TOLERANCE) {
+    st.out_of_range++;
+  }
+  const uint32_t reading = ch.calibrating ? width :
+      constrain(width, ep_min, ep_max);
+
+  if (st.pulses == 0) {
+    st.width_mean = width << 4;
+  }
+  st.pulses++;
+  st.last_pulse = cur_time;
+  if (width < st.width_min) st.width_min = width;
+  if (width > st.width_max) st.width_max = width;
+
+  // Exponential moving average of the mean and the variance
+  const int32_t dev = (int32_t)(width << 4) - st.width_mean;
+  st.width_mean += dev >> STATS_SHIFT;
+  const uint32_t dev_abs = abs(dev) >> 4;
+  // Clamped to 8 bits, so that the square is a single hardware multiply.
+  const uint8_t dev_us = min(dev_abs, (uint32_t)STATS_DEV_MAX);
+  const uint16_t sq = (uint16_t)dev_us * dev_us;
+  st.jitter_var += (((int32_t)sq << 4) - (int32_t)st.jitter_var) >> STATS_SHIFT;
+
+  return reading;
+}
+
+uint32_t Channel::gap_remaining() const {
+  noInterrupts();
+  const uint32_t rise_time = _rise_time;
+  const uint32_t fall_time = _fall_time;
+  const uint32_t period = _stats.period;
+  interrupts();
+
+  if (lost || period < FRAME_MIN_PERIOD || period > FRAME_MAX_PERIOD) {
+    return NO_PHASE;
+  }
+  // Pulse in progress
+  if ((int32_t)(rise_time - fall_time) >= 0) return 0;
+
+  uint32_t elapsed = micros() - rise_time;
+  if (elapsed >= period) {
+    // The next edge is due, but might be slightly late due to jitter.
+    if (elapsed < period + FRAME_LATE_TOLERANCE) return 0;
+    // Frames might be missed, so align to the latest expected one.
+    elapsed %= period;
+  }
+  return period - elapsed;
+}
+
+uint32_t Channel::frame_period() const {
+  noInterrupts();
+  const uint32_t period = _stats.period;
+  interrupts();
+
+  if (lost || period < FRAME_MIN_PERIOD || period > FRAME_MAX_PERIOD) return 0;
+  return period;
+}
+
 void isr_pwm(Channel& ch) {
   const uint32_t cur_time = micros();
+  ch._edges++;
   if (digitalRead(ch.pin) == HIGH) { // Rise
+    const uint32_t period = cur_time - ch._rise_time;
+    ch._stats.period = min(period, (uint32_t)0xffff);
     ch._rise_time = cur_time;
   } else { // Fall
-    ch._pulse_width = cur_time - ch._rise_time;
+    const uint32_t width = cur_time - ch._rise_time;
+    ch._fall_time = cur_time;
+    const uint32_t reading = update_stats(ch, width, cur_time);
+    if (reading > 0 && ch._pulse_cnt < 0xffff) {
+      ch._pulse_sum += reading;
+      ch._pulse_cnt++;
+    }
   }
 }
 
+static inline void update_signal_loss(Channel& ch) {
+  static char log_buf[64];
+
+  noInterrupts();
+  const uint32_t pulses = ch._stats.pulses;
+  const uint32_t last_pulse = ch._stats.last_pulse;
+  interrupts();
+
+  const bool lost = pulses == 0 ||
+      micros() - last_pulse > SIGNAL_LOSS_TIMEOUT * 1000UL;
+  if (lost == ch.lost) return;
+  ch.lost = lost;
+  if (lost) {
+    ch.losses++;
+    sprintf(log_buf, "[CHANNEL %u] Signal lost\r\n", (unsigned)ch.id);
+  } else {
+    sprintf(log_buf, "[CHANNEL %u] Signal acquired\r\n", (unsigned)ch.id);
+  }
+  LOGPRINT(3, log_buf);
+}
+
 void poll_channels() {
+  uint32_t pulse_sum[CH_MAXNUM];
+  uint16_t pulse_cnt[CH_MAXNUM];
+
+  PROF_MARK(PROF_POLL);
   // Access global raw states while temporarily disabling interrupts.
   noInterrupts();
   for (int i = 0; i < CH_MAXNUM; i++) {
-    channels[i].raw_val = channels[i]._pulse_width;
+    pulse_sum[i] = channels[i]._pulse_sum;
+    pulse_cnt[i] = channels[i]._pulse_cnt;
+    channels[i]._pulse_sum = 0;
+    channels[i]._pulse_cnt = 0;
   }
   interrupts();
 
   for (int i = 0; i < CH_MAXNUM; i++) {
+    if (pulse_cnt[i] > 0) {
+      channels[i].raw_val = (pulse_sum[i] + pulse_cnt[i] / 2) / pulse_cnt[i];
+    }
+    channels[i].polled_pulses = pulse_cnt[i];
     channels[i].update_value();
+    update_signal_loss(channels[i]);
   }
+  PROF_MARK(PROF_LOOP);
 }
 
 void setup_channels() {
@@ -27,6 +27,30 @@ enum ChannelIdx {
   CH_MAXNUM
 };
 
+/**
+ * Receiver Health
+ */
+// Plausible range of a pulse width (in us), anything outside is a glitch
+#define PULSE_MIN_WIDTH 500
+#define PULSE_MAX_WIDTH 2500
+// Tolerance beyond the endpoints before a pulse is counted as out of range
+// (in us) (Such pulses are still clamped to the endpoints and accepted)
+#define PULSE_EP_TOLERANCE 100
+// Time without a valid pulse before the signal is considered lost (in ms)
+#define SIGNAL_LOSS_TIMEOUT 100
+// Frame periods outside of this range are not tracked (in us)
+#define FRAME_MIN_PERIOD 4000
+#define FRAME_MAX_PERIOD 30000
+// A rising edge this late is still treated as imminent, rather than as a
+// missed frame (in us)
+#define FRAME_LATE_TOLERANCE 1000
+// Returned by Channel::gap_remaining() when the frame phase is unknown
+#define NO_PHASE 0xffffffff
+// Weight of a new pulse in the running statistics (1/2^n)
+#define STATS_SHIFT 3
+// Deviations are clamped to this before being squared (in us)
+#define STATS_DEV_MAX 255
+
 /** Endpoints data. */
 struct Endpoints {
   /* Lower endpoint */
@@ -37,6 +61,28 @@ struct Endpoints {
   uint32_t h = 2000;
 };
 
+/** Receiver health statistics, maintained by the ISR. */
+struct ChannelStats {
+  /* Number of valid pulses */
+  uint32_t pulses = 0;
+  /* Number of pulses outside of the plausible range */
+  uint16_t glitches = 0;
+  /* Number of valid pulses beyond the endpoints */
+  uint16_t out_of_range = 0;
+  /* Frame period between two rising edges (in us) */
+  uint16_t period = 0;
+  /* Shortest valid pulse width (in us) */
+  uint16_t width_min = 0xffff;
+  /* Longest valid pulse width (in us) */
+  uint16_t width_max = 0;
+  /* Running mean of the pulse width (in 1/16 us) */
+  uint16_t width_mean = 0;
+  /* Running variance of the pulse width, i.e. jitter (in 1/16 us^2) */
+  uint32_t jitter_var = 0;
+  /* Time of the falling edge of the last valid pulse (in us) */
+  uint32_t last_pulse = 0;
+};
+
 /** Channel input states. */
 class Channel {
 public:
@@ -47,15 +93,31 @@ public:
 
   /** Scaled and calibrated value. [-100, 100] */
   int8_t value = 0;
-  /** Raw pulse width (in us). */
-  uint32_t raw_val = 0;
+  /** Raw pulse width, averaged over the pulses since the last poll (in us). */
+  uint32_t raw_val = 1500;
+  /** Number of pulses averaged into raw_val by the last poll. */
+  uint16_t polled_pulses = 0;
   /** Endpoints */
   Endpoints ep;
+  /** Whether no valid pulse was received recently. */
+  bool lost = true;
+  /** Number of times the signal was lost. */
+  uint16_t losses = 0;
+  /** Keep pulses beyond the endpoints unclamped, e.g. while calibrating. */
+  volatile bool calibrating = false;
 
   /** Time of the rising edge of a pulse. */
   volatile uint32_t _rise_time = 0;
-  /** Pulse width of the PWM signal (in us). */
-  volatile uint32_t _pulse_width = 1500;
+  /** Time of the falling edge of a pulse. */
+  volatile uint32_t _fall_time = 0;
+  /** Number of edges received, wraps around. */
+  volatile uint8_t _edges = 0;
+  /** Sum of the accepted pulse widths since the last poll (in us). */
+  volatile uint32_t _pulse_sum = 0;
+  /** Number of the accepted pulses since the last poll. */
+  volatile uint16_t _pulse_cnt = 0;
+  /** Receiver health statistics, only to be accessed with get_stats(). */
+  ChannelStats _stats;
 
   /** Initialize channel. */
   Channel(uint32_t id, uint32_t pin) : id(id), pin(pin) {
@@ -75,6 +137,38 @@ public:
     }
   }
 
+  /**
+   * Whether any pulse was accepted since the last poll. Every pulse but a
+   * glitch is accepted, same as for the signal loss detection.
+   */
+  inline bool has_new_pulses() const {
+    return _pulse_cnt != 0;
+  }
+
+  /** Take a snapshot of the receiver health statistics. */
+  inline void get_stats(ChannelStats& stats) const {
+    noInterrupts();
+    stats = _stats;
+    interrupts();
+  }
+
+  /** Clear the receiver health statistics. */
+  inline void reset_stats() {
+    noInterrupts();
+    _stats = ChannelStats();
+    interrupts();
+  }
+
+  /**
+   * Time until the next pulse is expected to start (in us), based on the
+   * phase of the last pulse. Returns 0 while a pulse is in progress, or
+   * NO_PHASE if there is no signal.
+   */
+  uint32_t gap_remaining() const;
+
+  /** Measured frame period (in us), or 0 if there is no signal. */
+  uint32_t frame_period() const;
+
   /** Load endpoints from EEPROM. Use fallback if data out of range. */
   void load_ep();
 
@@ -86,7 +180,11 @@ public:
 extern Channel channels[CH_MAXNUM];
 
 /**
- * Propagate raw readings from shared variables to values.
+ * Propagate raw readings from shared variables to values, and update the
+ * signal loss states.
+ *
+ * The raw value is the average of the pulses accepted since the last poll, or
+ * unchanged if there are none.
  */
 void poll_channels();
 
@@ -77,6 +77,15 @@
 // Dim head lights after a period of inactivity (in ms) (-1 to disable)
 #define HEADLIGHT_DIM_TIMEOUT 3000
 
+/**
+ * Update Mode
+ *
+ * When enabled, the throttle-dependent lights (brake, decel, backfire) are
+ * updated as soon as a new throttle pulse is received, instead of on every
+ * refresh. Time-based lights are still updated on every refresh.
+ */
+#define EVENT_DRIVEN true
+
 /**
  * Log Verbosity
  *
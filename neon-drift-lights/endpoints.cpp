@@ -58,6 +58,8 @@ static inline uint32_t read_calibrate_ep(const Channel& ch,
   do delay(REFRESH_INTERVAL); while (IS_BTN_DN(PIN_EP_BTN));
   while (IS_BTN_UP(PIN_EP_BTN)) {
     set_status_light(true, status_blinks);
+    // Keep polling so the reading only averages the latest pulses.
+    poll_channels();
     delay(REFRESH_INTERVAL);
   }
   poll_channels();
@@ -71,6 +73,7 @@ static inline void calibrate_ch_ep(Channel& ch) {
 
   LOGPRINT(2, "[EP] Start Calibration\r\n");
   set_status_light(true, 0);
+  ch.calibrating = true;
 
   LOGPRINT(2, "[EP] Set EP_L then press the button:\r\n");
   ch.ep.l = read_calibrate_ep(ch, 1);
@@ -87,6 +90,7 @@ static inline void calibrate_ch_ep(Channel& ch) {
   sprintf(log_buf, "[EP] Calibrated EP_C: %d\r\n", ch.ep.c);
   LOGPRINT(2, log_buf);
 
+  ch.calibrating = false;
   ch.save_ep();
   LOGPRINT(2, "[EP] End Calibration\r\n");
 }
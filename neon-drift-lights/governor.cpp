@@ -0,0 +1,113 @@
+/**
+ * Copyright 2025 Yat Long Poon
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+
+#include "channel.h"
+#include "config.h"
+#include "governor.h"
+#include "utils.h"
+
+static GovernorStats stats = {QUALITY_FULL, 0, 0, {0}, 0};
+static uint32_t frame_start = 0;
+static uint8_t overrun_streak = 0;
+static uint16_t recover_streak = 0;
+
+static inline void set_quality(QualityLevel level) {
+  static char log_buf[64];
+  sprintf(log_buf, "[GOVERNOR] Quality level %u -> %u\r\n",
+      (unsigned)stats.level, (unsigned)level);
+  LOGPRINT(3, log_buf);
+  stats.level = level;
+  overrun_streak = 0;
+  recover_streak = 0;
+}
+
+/**
+ * Time budget of the current frame (in us). With EVENT_DRIVEN, frames follow
+ * the throttle pulses unless there is no signal.
+ */
+static inline uint32_t frame_budget() {
+#if EVENT_DRIVEN && !defined(RUN_TEST)
+  const uint32_t period = channels[CH_THROT].frame_period();
+  if (period > 0) return period;
+#endif
+  return GOVERNOR_BUDGET;
+}
+
+/**
+ * Next quality level in the direction `dir` (1 to step down, -1 to step up).
+ */
+static inline QualityLevel step_quality(int8_t dir) {
+  QualityLevel level = (QualityLevel)(stats.level + dir);
+#if VERBOSE != 0
+  // Virtual lights are compiled out, so the level would change nothing.
+  if (level == QUALITY_NO_VIRTUAL) level = (QualityLevel)(level + dir);
+#endif
+  return level;
+}
+
+void governor_begin_frame() {
+  frame_start = micros();
+}
+
+void governor_end_frame() {
+  const uint32_t frame_time = micros() - frame_start;
+  const uint32_t budget = frame_budget();
+  stats.frames++;
+  if (frame_time > stats.max_frame_time) stats.max_frame_time = frame_time;
+
+  if (frame_time > budget) {
+    stats.overruns++;
+    stats.level_overruns[stats.level]++;
+    recover_streak = 0;
+    if (++overrun_streak >= GOVERNOR_STEP_DN &&
+        stats.level < QUALITY_MAXNUM - 1) {
+      set_quality(step_quality(1));
+    }
+  } else {
+    overrun_streak = 0;
+    if (frame_time > budget * GOVERNOR_RECOVER_PCT / 100) {
+      recover_streak = 0;
+    } else if (++recover_streak >= GOVERNOR_STEP_UP &&
+        stats.level > QUALITY_FULL) {
+      set_quality(step_quality(-1));
+    }
+  }
+}
+
+QualityLevel get_quality() {
+  return stats.level;
+}
+
+const GovernorStats& get_governor_stats() {
+  return stats;
+}
+
+void debug_governor() {
+  static char log_buf[128];
+  sprintf(log_buf, "[GOVERNOR] level = %u frames = %lu overruns = %lu",
+      (unsigned)stats.level, (unsigned long)stats.frames,
+      (unsigned long)stats.overruns);
+  LOGPRINT(4, log_buf);
+  for (int i = 0; i < QUALITY_MAXNUM; i++) {
+    sprintf(log_buf, " [%d] = %lu", i, (unsigned long)stats.level_overruns[i]);
+    LOGPRINT(4, log_buf);
+  }
+  sprintf(log_buf, " max_frame_time = %lu\r\n",
+      (unsigned long)stats.max_frame_time);
+  LOGPRINT(4, log_buf);
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2025 Yat Long Poon
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "utils.h"
+
+/**
+ * Quality Governor
+ *
+ * Measures the work done in each frame of loop() against the time until the
+ * next frame.
+ * After repeated overruns, the quality is stepped down one level at a time,
+ * and stepped back up after a run of frames well within the budget. The brake
+ * lights are always updated at full rate.
+ */
+// Time budget of a frame (in us) (With EVENT_DRIVEN, the measured throttle
+// frame period is used instead while there is a signal)
+#define GOVERNOR_BUDGET (REFRESH_INTERVAL * 1000UL)
+// Consecutive overruns before stepping down
+#define GOVERNOR_STEP_DN 3
+// Consecutive frames within GOVERNOR_RECOVER_PCT of the budget before stepping
+// up
+#define GOVERNOR_STEP_UP 100
+#define GOVERNOR_RECOVER_PCT 50
+// Strips are pushed once every this many frames at QUALITY_SLOW_STRIPS
+#define GOVERNOR_STRIP_DIVIDER 2
+
+/** Quality levels, in the order they are stepped down. */
+enum QualityLevel {
+  QUALITY_FULL = 0,
+  // Skip virtual lights output (Only used with VERBOSE 0)
+  QUALITY_NO_VIRTUAL,
+  // Lower the strip update rate
+  QUALITY_SLOW_STRIPS,
+  // Switch strip states without cross-fades
+  QUALITY_SIMPLE,
+  QUALITY_MAXNUM
+};
+
+/** Frame time statistics. */
+struct GovernorStats {
+  /* Current quality level */
+  QualityLevel level;
+  /* Number of frames measured */
+  uint32_t frames;
+  /* Number of frames over budget */
+  uint32_t overruns;
+  /* Number of frames over budget at each quality level */
+  uint32_t level_overruns[QUALITY_MAXNUM];
+  /* Longest frame (in us) */
+  uint32_t max_frame_time;
+};
+
+/**
+ * Mark the start of the work in a frame.
+ */
+void governor_begin_frame();
+
+/**
+ * Mark the end of the work in a frame, and adapt the quality level.
+ */
+void governor_end_frame();
+
+/**
+ * Get the current quality level.
+ */
+QualityLevel get_quality();
+
+/**
+ * Get the frame time statistics.
+ */
+const GovernorStats& get_governor_stats();
+
+/**
+ * Print the frame time statistics.
+ */
+void debug_governor();
@@ -19,14 +19,89 @@
 
 #include "channel.h"
 #include "config.h"
+#include "governor.h"
+#include "outputs.h"
 #include "utils.h"
 #include "lights.h"
 
 static CRGB decel_lights[DECEL_LED_PIXELS];
 static CRGB brake2_lights[BRAKE2_LED_PIXELS];
 
+static CRGB decel_from[DECEL_LED_PIXELS];
+static CRGB decel_to[DECEL_LED_PIXELS];
+static StripFade decel_fade = {
+  decel_lights, decel_from, decel_to, DECEL_LED_PIXELS, DECEL_FADE_TIME, 0, false
+};
+static CRGB brake2_from[BRAKE2_LED_PIXELS];
+static CRGB brake2_to[BRAKE2_LED_PIXELS];
+static StripFade brake2_fade = {
+  brake2_lights, brake2_from, brake2_to, BRAKE2_LED_PIXELS, BRAKE2_FADE_TIME,
+  0, false
+};
+static StripStats strip_stats = {0, 0, 0, 0, 0};
+
+/**
+ * Interval between updates of the strips (in ms). With EVENT_DRIVEN, they
+ * follow the throttle frames unless there is no signal.
+ */
+static inline uint32_t strip_update_interval() {
+#if EVENT_DRIVEN && !defined(RUN_TEST)
+  const uint32_t period = channels[CH_THROT].frame_period();
+  if (period > 0) return (period + 500) / 1000;
+#endif
+  return REFRESH_INTERVAL;
+}
+
+/**
+ * Start fading from the frame currently shown to the frame in `fade.to`.
+ *
+ * The fade starts one update in the past, so that the first step already
+ * shows part of the new frame. Fades shorter than two updates would not show
+ * any blend, so they switch instantly on the first step instead.
+ */
+static inline void start_fade(StripFade& fade) {
+  const uint32_t interval = strip_update_interval();
+  memcpy(fade.from, fade.leds, fade.len * sizeof(CRGB));
+  fade.start_time = millis() -
+      (fade.duration < 2 * interval ? fade.duration : interval);
+  fade.is_active = true;
+}
+
+/**
+ * Blend the shown frame for the current point of the fade, using FastLED's
+ * 8-bit blend over the whole strip. Fades are skipped at QUALITY_SIMPLE.
+ *
+ * Returns whether the shown frame changed.
+ */
+static inline bool step_fade(StripFade& fade) {
+  if (!fade.is_active) return false;
+
+  const uint32_t elapsed = millis() - fade.start_time;
+  if (elapsed >= fade.duration || get_quality() >= QUALITY_SIMPLE) {
+    memcpy(fade.leds, fade.to, fade.len * sizeof(CRGB));
+    fade.is_active = false;
+    return true;
+  }
+  memcpy(fade.leds, fade.from, fade.len * sizeof(CRGB));
+  nblend(fade.leds, fade.to, fade.len, (elapsed << 8) / fade.duration);
+  return true;
+}
+
+/**
+ * Step the fades of all strips. Returns whether the brake light strip
+ * changed.
+ */
+static inline bool fade_strips() {
+  PROF_MARK(PROF_FADE_DECEL);
+  step_fade(decel_fade);
+  PROF_MARK(PROF_FADE_BRAKE2);
+  const bool brake2_changed = step_fade(brake2_fade);
+  PROF_MARK(PROF_LOOP);
+  return brake2_changed;
+}
+
 static inline void handle_head_lights(const Channel channels[]) {
-  static CHFilter filter(BRAKE_SMOOTHING);
+  static CHFilter filter(HEAD_SMOOTHING);
   static uint32_t last_tar = 0;
 
   uint32_t tar_value = 0;
@@ -38,40 +113,31 @@ static inline void handle_head_lights(const Channel channels[]) {
   }
 #else
   static uint32_t idle_st_time = (uint32_t)(-HEADLIGHT_DIM_TIMEOUT);
-  static BlinkData hz_data = {
-    .is_enabled = false,
-    .start_time = millis(),
-    .interval = HAZARD_INTERVAL,
-    .duration = HAZARD_INTERVAL,
-  };
+  bool hz_enabled = false;
 
   const uint32_t cur_time = millis();
   if (abs(channels[CH_THROT].value) >= 10 || HEADLIGHT_DIM_TIMEOUT < 0) {
     tar_value = HEAD_LIGHT_MAX;
-    hz_data.is_enabled = false;
     idle_st_time = cur_time;
   } else {
     if (cur_time - idle_st_time >= HEADLIGHT_DIM_TIMEOUT) {
       tar_value = HEAD_LIGHT_MID;
-      hz_data.is_enabled = true;
+      hz_enabled = true;
       idle_st_time = cur_time - HEADLIGHT_DIM_TIMEOUT;
     } else {
       tar_value = HEAD_LIGHT_MAX;
-      hz_data.is_enabled = false;
     }
   }
 
-  if (hz_data.is_enabled) {
-    if (cur_time - hz_data.start_time >= hz_data.interval + hz_data.duration) {
-      digitalWrite(PIN_LED_HAZARD, LOW);
-      hz_data.start_time = cur_time;
-    } else if (cur_time - hz_data.start_time >= hz_data.interval) {
-      digitalWrite(PIN_LED_HAZARD, HIGH);
-    } else {
-      digitalWrite(PIN_LED_HAZARD, LOW);
+  if (hz_enabled) {
+    // Keep the next blink queued, so that the queue never runs dry between
+    // two refreshes and the period does not drift.
+    if (pending_outputs(OUT_HAZARD) <= 2) {
+      schedule_output(OUT_HAZARD, HAZARD_INTERVAL, HIGH);
+      schedule_output(OUT_HAZARD, HAZARD_INTERVAL, LOW);
     }
   } else {
-    digitalWrite(PIN_LED_HAZARD, LOW);
+    clear_output(OUT_HAZARD, LOW);
   }
 #endif
 
@@ -87,35 +153,131 @@ static inline void handle_head_lights(const Channel channels[]) {
 
 static inline void handle_brake_lights(const Channel channels[]) {
   static CHFilter filter(BRAKE_SMOOTHING);
+  static bool was_braking = false;
 
   uint32_t tar_value = 0;
-  if (channels[CH_THROT].value < BRAKE_THRESH) {
+  const bool is_braking = channels[CH_THROT].value < BRAKE_THRESH;
+  if (is_braking) {
     tar_value = BRAKE_LIGHT_MAX;
-    fill_solid(brake2_lights, BRAKE2_LED_PIXELS, BRAKE2_COLOR_RED);
   } else {
 #if BRAKE_AS_TAIL_LIGHTS
     tar_value = BRAKE_LIGHT_MID;
 #else
     tar_value = 0;
 #endif
-    fill_solid(brake2_lights, BRAKE2_LED_PIXELS, CRGB::Black);
+  }
+
+  if (is_braking != was_braking) {
+    if (is_braking) {
+      fill_solid(brake2_to, BRAKE2_LED_PIXELS, BRAKE2_COLOR_RED);
+    } else {
+      fill_solid(brake2_to, BRAKE2_LED_PIXELS, CRGB::Black);
+    }
+    start_fade(brake2_fade);
+    was_braking = is_braking;
   }
 
   analogWrite(PIN_LED_BRAKE, filter.update_step(tar_value));
 }
 
-static inline void set_decel_pixel(uint32_t i, uint32_t color) {
+/**
+ * Decel light frames
+ *
+ * Every state of the decel light strip is generated at compile time. The
+ * frames are stored in flash, followed by a table mapping each throttle value
+ * in [-100, 100] to its frame.
+ */
+// Green bars of length [0, DECEL_LED_PIXELS]
+#define DECEL_FRAME_GREEN(n) (n)
+// Yellow bars of length [0, DECEL_LED_PIXELS]
+#define DECEL_FRAME_YELLOW(n) (DECEL_LED_PIXELS + 1 + (n))
+// Full red
+#define DECEL_FRAME_RED (2 * DECEL_LED_PIXELS + 2)
+// Blue bar (idle)
+#define DECEL_FRAME_IDLE (2 * DECEL_LED_PIXELS + 3)
+// Number of frames
+#define DECEL_FRAME_NUM (2 * DECEL_LED_PIXELS + 4)
+// Length of the blue bar, i.e. round(DECEL_LED_PIXELS / 3)
+#define DECEL_IDLE_LEN ((DECEL_LED_PIXELS + 1) / 3)
+
+static constexpr int32_t ceil_div(int32_t a, int32_t b) {
+  return (a + b - 1) / b;
+}
+
+static constexpr uint32_t decel_frame_color(uint16_t frame, int32_t i) {
+  return frame <= DECEL_FRAME_GREEN(DECEL_LED_PIXELS)
+      ? (i < frame - DECEL_FRAME_GREEN(0) ? DECEL_COLOR_GREEN : 0)
+    : frame <= DECEL_FRAME_YELLOW(DECEL_LED_PIXELS)
+      ? (i >= DECEL_LED_PIXELS - (frame - DECEL_FRAME_YELLOW(0))
+          ? DECEL_COLOR_YELLOW : 0)
+    : frame == DECEL_FRAME_RED
+      ? DECEL_COLOR_RED
+      : (i >= DECEL_LED_PIXELS - DECEL_IDLE_LEN ? DECEL_COLOR_BLUE : 0);
+}
+
+static constexpr uint8_t decel_frame_byte(uint16_t frame, uint16_t offset) {
+  // Bytes are laid out as in CRGB, i.e. r, g, b for each pixel.
+  return decel_frame_color(frame,
 #if DECEL_LED_REVERSE
-  decel_lights[DECEL_LED_PIXELS - i - 1] = color;
+      DECEL_LED_PIXELS - 1 - offset / 3
 #else
-  decel_lights[i] = color;
+      offset / 3
 #endif
+      ) >> (16 - 8 * (offset % 3)) & 0xff;
+}
+
+static constexpr uint8_t decel_frame_index(int32_t throt) {
+  return (throt > -DECEL_NULL_THRESH && throt < DECEL_NULL_THRESH)
+      ? DECEL_FRAME_IDLE
+    : throt >= 0
+      ? DECEL_FRAME_GREEN(ceil_div((throt - DECEL_NULL_THRESH)
+          * DECEL_LED_PIXELS, 100 - DECEL_NULL_THRESH))
+    : throt < DECEL_BRAKE_THRESH
+      ? DECEL_FRAME_RED
+      : DECEL_FRAME_YELLOW(ceil_div(-throt * DECEL_LED_PIXELS, 100));
 }
 
+struct DecelFrame {
+  uint8_t raw[sizeof(CRGB) * DECEL_LED_PIXELS];
+};
+
+template <uint16_t F, typename ByteSeq>
+struct DecelFrameRow;
+
+template <uint16_t F, uint16_t... Bs>
+struct DecelFrameRow<F, IndexSeq<Bs...>> {
+  static constexpr DecelFrame make() {
+    return DecelFrame{{ decel_frame_byte(F, Bs)... }};
+  }
+};
+
+struct DecelFrameTable {
+  DecelFrame frames[DECEL_FRAME_NUM];
+  uint8_t index[201];
+};
+
+template <uint16_t... Fs, uint16_t... Ts>
+static constexpr DecelFrameTable make_decel_frames(IndexSeq<Fs...>,
+    IndexSeq<Ts...>) {
+  return DecelFrameTable{
+    { DecelFrameRow<Fs, MakeIndexSeq<sizeof(DecelFrame)>::type>::make()... },
+    { decel_frame_index((int32_t)Ts - 100)... },
+  };
+}
+
+static constexpr DecelFrameTable decel_frames PROGMEM = make_decel_frames(
+    MakeIndexSeq<DECEL_FRAME_NUM>::type(), MakeIndexSeq<201>::type());
+
+static_assert(sizeof(DecelFrame) == sizeof(decel_to),
+    "Decel frame size mismatch");
+
 static inline void handle_decel_lights(const Channel channels[]) {
   static CHFilter filter(DECEL_SMOOTHING_UP);
   static CHFilter filter2(DECEL_SMOOTHING_DN);
+#if !EVENT_DRIVEN
   static uint32_t last_update = 0;
+#endif
+  static uint8_t last_frame = DECEL_FRAME_NUM;
 
   const int32_t value = channels[CH_THROT].value;
   const int32_t throt2 = filter2.update_step(value);
@@ -124,66 +286,123 @@ static inline void handle_decel_lights(const Channel channels[]) {
     throt = throt2;
   }
 
+#if !EVENT_DRIVEN
   // Skip updating
   const uint32_t cur_time = millis();
   if (cur_time - last_update < DECEL_UPDATE_RATE) return;
   last_update = cur_time;
+#endif
 
-  fill_solid(decel_lights, DECEL_LED_PIXELS, CRGB::Black);
-  if (abs(throt) < DECEL_NULL_THRESH) {
-    const uint32_t bar_len = round((float)DECEL_LED_PIXELS/3);
-    for (int i = 1; i <= bar_len; i++)
-      set_decel_pixel(DECEL_LED_PIXELS - i, DECEL_COLOR_BLUE);
-  } else if (throt >= 0) {
-    const uint32_t bar_len = ceil(
-        ((float)throt - DECEL_NULL_THRESH) / (100.0f - DECEL_NULL_THRESH)
-        * DECEL_LED_PIXELS);
-    for (int i = 0; i < bar_len; i++)
-      set_decel_pixel(i, DECEL_COLOR_GREEN);
-  } else if (throt < DECEL_BRAKE_THRESH) {
-    for (int i = 0; i < DECEL_LED_PIXELS; i++)
-      set_decel_pixel(i, DECEL_COLOR_RED);
-  } else {
-    const uint32_t bar_len = ceil(throt / -100.0f * DECEL_LED_PIXELS);
-    for (int i = 1; i <= bar_len; i++)
-      set_decel_pixel(DECEL_LED_PIXELS - i, DECEL_COLOR_YELLOW);
+  const uint8_t frame = pgm_read_byte(
+      &decel_frames.index[constrain(throt, -100, 100) + 100]);
+  if (frame == last_frame) return;
+  last_frame = frame;
+  memcpy_P(decel_to, &decel_frames.frames[frame], sizeof(decel_to));
+  start_fade(decel_fade);
+}
+
+/**
+ * Backfire sequences
+ *
+ * Pops are stored in flash and grouped into sequences. Lifting off the
+ * throttle plays rapid bursts, while holding high throttle plays sparse pops.
+ */
+static const BackfirePop backfire_pops[] PROGMEM = {
+  // Lift off
+  {0, 20}, {30, 10}, {20, 30},
+  {10, 40}, {60, 15},
+  {0, 10}, {15, 10}, {15, 10}, {40, 25},
+  {0, 15}, {25, 45},
+  // High throttle
+  {80, 15},
+  {120, 30}, {150, 10},
+  {60, 10}, {200, 20},
+};
+
+static const BackfireSeq backfire_lift_seqs[] PROGMEM = {
+  {0, 3}, {3, 2}, {5, 4}, {9, 2},
+};
+
+static const BackfireSeq backfire_high_seqs[] PROGMEM = {
+  {11, 1}, {12, 2}, {14, 2},
+};
+
+static XorShift16 backfire_rng(BACKFIRE_SEED);
+
+static inline void schedule_backfire(const BackfireSeq& seq) {
+  for (int i = seq.start; i < seq.start + seq.len; i++) {
+    BackfirePop pop;
+    memcpy_P(&pop, &backfire_pops[i], sizeof(pop));
+    schedule_output(OUT_BACKFIRE,
+        pop.gap + backfire_rng.next(BACKFIRE_JITTER), HIGH);
+    schedule_output(OUT_BACKFIRE, pop.duration, LOW);
   }
 }
 
 static inline void handle_backfire(const Channel channels[]) {
   static CHFilter filter(BACKFIRE_SMOOTHING);
   static int32_t throt_last = 0;
-  static BlinkData bf_data = {
-    .is_enabled = false,
-    .start_time = millis(),
-    .interval = 0,
-    .duration = 0,
-  };
 
-  const uint32_t cur_time = millis();
   const int32_t throt = filter.update_step(channels[CH_THROT].value);
   if ((throt < throt_last && throt_last >= BACKFIRE_THRESH_L) ||
       throt >= BACKFIRE_THRESH_H) {
-    if (!bf_data.is_enabled) {
-      bf_data.is_enabled = true;
-      bf_data.start_time = cur_time;
-      bf_data.interval = random(BACKFIRE_MAX_INTERVAL);
-      bf_data.duration = random(BACKFIRE_MAX_DURATION);
+    // Start a new sequence once the previous one has finished
+    if (is_output_idle(OUT_BACKFIRE)) {
+      BackfireSeq seq;
+      if (throt >= BACKFIRE_THRESH_H) {
+        const uint16_t n = sizeof(backfire_high_seqs) / sizeof(BackfireSeq);
+        memcpy_P(&seq, &backfire_high_seqs[backfire_rng.next(n)], sizeof(seq));
+      } else {
+        const uint16_t n = sizeof(backfire_lift_seqs) / sizeof(BackfireSeq);
+        memcpy_P(&seq, &backfire_lift_seqs[backfire_rng.next(n)], sizeof(seq));
+      }
+      schedule_backfire(seq);
     }
   }
 
-  if (bf_data.is_enabled) {
-    if (cur_time - bf_data.start_time >= bf_data.interval + bf_data.duration) {
-      digitalWrite(PIN_LED_BACKFIRE, LOW);
-      bf_data.is_enabled = false;
-    } else if (cur_time - bf_data.start_time >= bf_data.interval) {
-      digitalWrite(PIN_LED_BACKFIRE, HIGH);
-    }
-  } else {
-    digitalWrite(PIN_LED_BACKFIRE, LOW);
+  throt_last = throt;
+}
+
+/**
+ * Push the light strips in the gap between two throttle pulses.
+ *
+ * FastLED.show() blocks interrupts while pushing WS2812B data, so a receiver
+ * edge during the push is timestamped late and corrupts the pulse width. If
+ * the push does not fit in the remaining gap, wait for the current pulse to
+ * end first.
+ *
+ * At QUALITY_SLOW_STRIPS, only every GOVERNOR_STRIP_DIVIDER-th push is done,
+ * unless `force` is set (e.g. the brake light changed).
+ */
+static inline void show_strips(const Channel channels[], bool force) {
+  static uint8_t frame_cnt = 0;
+  const Channel& ch = channels[CH_THROT];
+
+  frame_cnt = (frame_cnt + 1) % GOVERNOR_STRIP_DIVIDER;
+  if (get_quality() >= QUALITY_SLOW_STRIPS && !force && frame_cnt != 0) {
+    strip_stats.skipped++;
+    return;
   }
 
-  throt_last = throt;
+  bool is_deferred = false;
+  if (ch.gap_remaining() < STRIP_PUSH_TIME) {
+    const uint32_t st_time = millis();
+    while (ch.gap_remaining() < STRIP_PUSH_TIME &&
+        millis() - st_time < STRIP_MAX_DEFER);
+    is_deferred = ch.gap_remaining() >= STRIP_PUSH_TIME;
+    if (!is_deferred) strip_stats.timeouts++;
+  }
+
+  const uint8_t edges = ch._edges;
+  PROF_MARK(PROF_SHOW);
+  FastLED.show();
+  PROF_MARK(PROF_LOOP);
+  strip_stats.shows++;
+  if (ch._edges != edges) {
+    strip_stats.collisions++;
+  } else if (is_deferred) {
+    strip_stats.avoided++;
+  }
 }
 
 #if VERBOSE == 0
@@ -191,6 +410,8 @@ static inline void handle_backfire(const Channel channels[]) {
  * Print simulated virtual lights in serial.
  */
 static inline void show_virtual_lights() {
+  if (get_quality() >= QUALITY_NO_VIRTUAL) return;
+
   Serial.print("\r ");
 
   if (digitalRead(PIN_LED_HEAD))
@@ -236,19 +457,58 @@ void handle_lights(const Channel channels[]) {
   handle_decel_lights(channels);
   handle_backfire(channels);
 
-  FastLED.show();
+  const bool brake2_changed = fade_strips();
+  show_strips(channels, brake2_changed);
 #if VERBOSE == 0
   show_virtual_lights();
 #endif
 }
 
+void handle_input_lights(const Channel channels[]) {
+  handle_brake_lights(channels);
+  handle_decel_lights(channels);
+  handle_backfire(channels);
+
+  const bool brake2_changed = fade_strips();
+  show_strips(channels, brake2_changed);
+#if VERBOSE == 0
+  show_virtual_lights();
+#endif
+}
+
+void handle_timed_lights(const Channel channels[]) {
+  handle_head_lights(channels);
+
+#if VERBOSE == 0
+  show_virtual_lights();
+#endif
+}
+
+const StripStats& get_strip_stats() {
+  return strip_stats;
+}
+
+void debug_lights() {
+  static char log_buf[128];
+  sprintf(log_buf, "[LIGHTS] shows = %lu avoided = %lu timeouts = %lu",
+      (unsigned long)strip_stats.shows, (unsigned long)strip_stats.avoided,
+      (unsigned long)strip_stats.timeouts);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " collisions = %lu skipped = %lu\r\n",
+      (unsigned long)strip_stats.collisions,
+      (unsigned long)strip_stats.skipped);
+  LOGPRINT(4, log_buf);
+}
+
+void seed_lights(uint16_t seed) {
+  backfire_rng.set_seed(seed);
+}
+
 void setup_lights() {
   pinMode(PIN_LED_HEAD, OUTPUT);
   pinMode(PIN_LED_BRAKE, OUTPUT);
   pinMode(PIN_LED_BRAKE2, OUTPUT);
   pinMode(PIN_LED_DECEL, OUTPUT);
-  pinMode(PIN_LED_HAZARD, OUTPUT);
-  pinMode(PIN_LED_BACKFIRE, OUTPUT);
 
   FastLED.addLeds<WS2812B, PIN_LED_DECEL, GRB>(decel_lights, DECEL_LED_PIXELS);
   FastLED.addLeds<WS2812B, PIN_LED_BRAKE2, GRB>(brake2_lights, BRAKE2_LED_PIXELS);
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include <FastLED.h>
 
 #include "channel.h"
 
@@ -40,27 +41,39 @@
  * Size of average filter applied to the input/output signal. (0 to disable)
  */
 // Head lights gradient effect
-#define HEAD_SMOOTHING 4
+#define HEAD_SMOOTHING 2
 // Brake lights gradient effect
-#define BRAKE_SMOOTHING 2
+#define BRAKE_SMOOTHING 1
 // Smoothing for decel lights when increasing power
-#define DECEL_SMOOTHING_UP 2
+#define DECEL_SMOOTHING_UP 1
 // Smoothing for decel lights when braking
-#define DECEL_SMOOTHING_DN 1
+#define DECEL_SMOOTHING_DN 0
 // Gives a "delay" effect to the backfires
 #define BACKFIRE_SMOOTHING 8
 
 /**
- * Timings (Subject to REFRESH_INTERVAL)
+ * Timings
  */
-// How often the decel lights updates (in ms)
+// How often the decel lights updates (in ms) (Subject to REFRESH_INTERVAL)
+// (Ignored with EVENT_DRIVEN, which updates them on every pulse)
 #define DECEL_UPDATE_RATE 50
 // Hazard lights blink interval (in ms)
 #define HAZARD_INTERVAL 500
-// Maximum interval between two backfires (in ms)
-#define BACKFIRE_MAX_INTERVAL 200
-// Maximum duration of a backfire (in ms)
-#define BACKFIRE_MAX_DURATION 50
+// Cross-fade duration of the decel lights between states (in ms)
+// (Fades shorter than two strip updates switch instantly)
+#define DECEL_FADE_TIME 100
+// Cross-fade duration of the brake light strip (in ms) (See DECEL_FADE_TIME)
+// (Spans 3 receiver frames with EVENT_DRIVEN, but switches instantly on the
+// slower REFRESH_INTERVAL updates to keep the brake response quick)
+#define BRAKE2_FADE_TIME 60
+// Time to push all light strips, including margin (in us)
+#define STRIP_PUSH_TIME ((DECEL_LED_PIXELS + BRAKE2_LED_PIXELS) * 30 + 300)
+// Maximum time to wait for a gap between receiver pulses (in ms)
+#define STRIP_MAX_DEFER 5
+// Maximum random delay added before each backfire pop (in ms)
+#define BACKFIRE_JITTER 20
+// Seed for the backfire sequences
+#define BACKFIRE_SEED 0x2025
 
 /**
  * Colors and Intensities
@@ -76,15 +89,87 @@
 #define BRAKE_LIGHT_MID 64
 
 /*
- * Data structure for blinking lights.
+ * Cross-fade of a light strip from its current frame to a new one.
  */
-struct BlinkData {
-  bool is_enabled;
+struct StripFade {
+  /* Frame shown on the strip */
+  CRGB* const leds;
+  /* Frame at the start of the fade */
+  CRGB* const from;
+  /* Frame to fade to */
+  CRGB* const to;
+  /* Number of pixels */
+  const uint16_t len;
+  /* Duration of the fade (in ms) */
+  const uint16_t duration;
   uint32_t start_time;
-  uint32_t interval;
-  uint32_t duration;
+  bool is_active;
 };
 
+/*
+ * A single flash of a backfire sequence.
+ */
+struct BackfirePop {
+  /* Delay after the previous pop (in ms) */
+  uint8_t gap;
+  /* Duration of the flash (in ms) */
+  uint8_t duration;
+};
+
+/*
+ * A backfire sequence, i.e. a range of pops.
+ */
+struct BackfireSeq {
+  uint8_t start;
+  uint8_t len;
+};
+
+/*
+ * Light strip output statistics.
+ */
+struct StripStats {
+  /* Number of strip pushes */
+  uint32_t shows;
+  /* Pushes deferred until a gap opened, and done without overlapping a
+   * receiver edge (i.e. collisions avoided) */
+  uint32_t avoided;
+  /* Pushes deferred until STRIP_MAX_DEFER without a gap opening */
+  uint32_t timeouts;
+  /* Pushes that still overlapped a receiver edge */
+  uint32_t collisions;
+  /* Pushes skipped to reduce the update rate */
+  uint32_t skipped;
+};
+
+/**
+ * Update all lights.
+ */
 void handle_lights(const Channel channels[]);
 
+/**
+ * Update the lights that depend on the throttle, i.e. brake, decel and
+ * backfire lights.
+ */
+void handle_input_lights(const Channel channels[]);
+
+/**
+ * Update the time-based lights, i.e. head and hazard lights.
+ */
+void handle_timed_lights(const Channel channels[]);
+
+/**
+ * Get the light strip output statistics.
+ */
+const StripStats& get_strip_stats();
+
+/**
+ * Print the light statistics.
+ */
+void debug_lights();
+
+/**
+ * Reseed the random effects, e.g. to reproduce a recorded run.
+ */
+void seed_lights(uint16_t seed);
+
 void setup_lights();
@@ -17,7 +17,9 @@
 #include "channel.h"
 #include "config.h"
 #include "endpoints.h"
+#include "governor.h"
 #include "lights.h"
+#include "outputs.h"
 #include "tests.h"
 #include "utils.h"
 
@@ -29,17 +31,62 @@ void setup() {
   setup_ep_btn();
   setup_channels();
   setup_lights();
+  setup_outputs();
 }
 
 void loop() {
 #ifdef RUN_TEST
+  PROF_MARK(PROF_LOOP);
+  governor_begin_frame();
   do_test();
+  handle_lights(channels);
+  governor_end_frame();
+  PROF_MARK(PROF_IDLE);
+  delay(REFRESH_INTERVAL);
+#elif EVENT_DRIVEN
+  static uint32_t last_refresh = 0;
+  static bool has_event = false;
+
+  // React to every new throttle pulse
+  if (channels[CH_THROT].has_new_pulses()) {
+    PROF_MARK(PROF_LOOP);
+    governor_begin_frame();
+    poll_channels();
+    handle_input_lights(channels);
+    governor_end_frame();
+    PROF_MARK(PROF_IDLE);
+    has_event = true;
+  }
+
+  const uint32_t cur_time = millis();
+  if (cur_time - last_refresh >= REFRESH_INTERVAL) {
+    PROF_MARK(PROF_LOOP);
+    last_refresh = cur_time;
+    poll_ep_btn();
+    governor_begin_frame();
+    poll_channels();
+    if (!has_event || channels[CH_THROT].polled_pulses > 0) {
+      // Keep all lights running on the refresh when no pulse was reacted to
+      // since the last one, or when this poll consumed pulses that just
+      // arrived.
+      handle_lights(channels);
+    } else {
+      handle_timed_lights(channels);
+    }
+    has_event = false;
+    governor_end_frame();
+    PROF_MARK(PROF_IDLE);
+  }
 #else
+  PROF_MARK(PROF_LOOP);
   poll_ep_btn();
+  governor_begin_frame();
   poll_channels();
-#endif
 
   handle_lights(channels);
 
+  governor_end_frame();
+  PROF_MARK(PROF_IDLE);
   delay(REFRESH_INTERVAL);
+#endif
 }
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2025 Yat Long Poon
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "outputs.h"
+
+#if !defined(TIMSK0) || !defined(OCIE0A)
+#error "The output engine requires the Timer0 compare A interrupt (AVR)"
+#endif
+
+static Output outputs[OUT_MAXNUM] = {
+  {PIN_LED_HAZARD, 0, 0, {}},
+  {PIN_LED_BACKFIRE, 0, 0, {}},
+};
+
+static inline void write_output(uint8_t pin, uint8_t value) {
+  if (value == LOW || value == HIGH) {
+    digitalWrite(pin, value);
+  } else {
+    analogWrite(pin, value);
+  }
+}
+
+ISR(TIMER0_COMPA_vect) {
+  for (int i = 0; i < OUT_MAXNUM; i++) {
+    Output& out = outputs[i];
+    // Run all events that are due, including chained events without delay
+    while (out.head != out.tail) {
+      OutputEvent& ev = out.events[out.head];
+      if (ev.ticks > 0) {
+        ev.ticks--;
+        break;
+      }
+      write_output(out.pin, ev.value);
+      out.head = (out.head + 1) % OUTPUT_QUEUE_SIZE;
+    }
+  }
+}
+
+bool schedule_output(OutputIdx idx, uint16_t delay_ms, uint8_t value) {
+  Output& out = outputs[idx];
+  // One tick of Timer0 is 1.024 ms
+  uint16_t ticks = ((uint32_t)delay_ms * 125 + 64) / 128;
+
+  // The event must be complete before the ISR can see the new tail.
+  noInterrupts();
+  const uint8_t next = (out.tail + 1) % OUTPUT_QUEUE_SIZE;
+  if (next == out.head) {
+    interrupts();
+    return false;
+  }
+  // Chained events are counted down from the tick that ran the previous one,
+  // but the first one from the next tick.
+  if (out.head == out.tail && ticks > 0) ticks--;
+  OutputEvent& ev = out.events[out.tail];
+  ev.ticks = ticks;
+  ev.value = value;
+  out.tail = next;
+  interrupts();
+  return true;
+}
+
+void clear_output(OutputIdx idx, uint8_t value) {
+  Output& out = outputs[idx];
+  noInterrupts();
+  out.head = out.tail;
+  write_output(out.pin, value);
+  interrupts();
+}
+
+bool is_output_idle(OutputIdx idx) {
+  const Output& out = outputs[idx];
+  return out.head == out.tail;
+}
+
+uint8_t pending_outputs(OutputIdx idx) {
+  const Output& out = outputs[idx];
+  return (out.tail - out.head + OUTPUT_QUEUE_SIZE) % OUTPUT_QUEUE_SIZE;
+}
+
+void setup_outputs() {
+  for (int i = 0; i < OUT_MAXNUM; i++) {
+    pinMode(outputs[i].pin, OUTPUT);
+    digitalWrite(outputs[i].pin, LOW);
+  }
+
+  // Timer0 is already running for millis(), piggyback on its compare A.
+  TIMSK0 |= _BV(OCIE0A);
+}
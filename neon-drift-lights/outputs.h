@@ -0,0 +1,87 @@
+/**
+ * Copyright 2025 Yat Long Poon
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Output Engine
+ *
+ * Discrete lights are driven from the Timer0 compare A interrupt, which fires
+ * once per Timer0 overflow (about every 1 ms) alongside millis(). The main
+ * loop only queues events, so blink and flash timings do not depend on the
+ * refresh rate.
+ *
+ * analogWrite() must not be used on the OC0A pin (pin 11 on the Pro Micro),
+ * as it shares the compare register.
+ */
+// Maximum number of pending events per output
+#define OUTPUT_QUEUE_SIZE 16
+
+/** Output identifiers. */
+enum OutputIdx {
+  OUT_HAZARD = 0,
+  OUT_BACKFIRE,
+  OUT_MAXNUM
+};
+
+/** Set the output to a value after a delay. */
+struct OutputEvent {
+  /* Timer ticks to wait after the previous event */
+  uint16_t ticks;
+  /* LOW, HIGH or a PWM duty cycle */
+  uint8_t value;
+};
+
+/** Queue of events for an output pin. */
+struct Output {
+  /* Pin connected to the output */
+  const uint8_t pin;
+  /* Next event to run, only advanced by the ISR */
+  volatile uint8_t head;
+  /* Next free slot, only advanced by the main loop */
+  volatile uint8_t tail;
+  OutputEvent events[OUTPUT_QUEUE_SIZE];
+};
+
+/**
+ * Queue an event to set the output to `value` (LOW, HIGH or a PWM duty cycle)
+ * `delay_ms` after the previous queued event, or after now if there is none.
+ *
+ * Returns false if the queue is full.
+ */
+bool schedule_output(OutputIdx idx, uint16_t delay_ms, uint8_t value);
+
+/**
+ * Drop all pending events and set the output to `value` immediately.
+ */
+void clear_output(OutputIdx idx, uint8_t value);
+
+/**
+ * Whether the output has no pending events.
+ */
+bool is_output_idle(OutputIdx idx);
+
+/**
+ * Number of pending events of the output.
+ */
+uint8_t pending_outputs(OutputIdx idx);
+
+/**
+ * Set up output pins and the timer interrupt.
+ */
+void setup_outputs();
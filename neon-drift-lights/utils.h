@@ -29,6 +29,26 @@
 /** Interval between each refresh loop (in milliseconds) */
 #define REFRESH_INTERVAL 50
 
+/**
+ * Profiling Markers
+ *
+ * When built with SIM_PROFILE (see `make sim`), the current phase of the main
+ * loop is written to GPIOR0, which the simulator watches. Keep in sync with
+ * the phase names in sim/sim.c.
+ */
+#define PROF_IDLE 0
+#define PROF_LOOP 1
+#define PROF_POLL 2
+#define PROF_SHOW 3
+#define PROF_FADE_DECEL 4
+#define PROF_FADE_BRAKE2 5
+
+#ifdef SIM_PROFILE
+#define PROF_MARK(p) (GPIOR0 = (p))
+#else
+#define PROF_MARK(p)
+#endif
+
 inline void debug_channel(const Channel& ch) {
   static char log_buf[256];
   sprintf(log_buf, "[CHANNEL %u]", ch.id);
@@ -45,6 +65,74 @@ inline void debug_channel(const Channel& ch) {
   LOGPRINT(4, log_buf)
 }
 
+inline void debug_channel_stats(const Channel& ch) {
+  static char log_buf[256];
+  ChannelStats st;
+  ch.get_stats(st);
+  sprintf(log_buf, "[CHANNEL %u]", ch.id);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " pulses = %lu", (unsigned long)st.pulses);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " period = %u", st.period);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " width = [%u, %u]", st.width_min, st.width_max);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " mean = %u", st.width_mean >> 4);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " jitter_var = %lu", (unsigned long)(st.jitter_var >> 4));
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " glitches = %u", st.glitches);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " out_of_range = %u", st.out_of_range);
+  LOGPRINT(4, log_buf);
+  sprintf(log_buf, " losses = %u%s\r\n", ch.losses, ch.lost ? " (lost)" : "");
+  LOGPRINT(4, log_buf)
+}
+
+/**
+ * Compile-time index sequence, used to generate lookup tables in flash.
+ */
+template <uint16_t... Is>
+struct IndexSeq {};
+
+template <uint16_t N, uint16_t... Is>
+struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, Is...> {};
+
+template <uint16_t... Is>
+struct MakeIndexSeq<0, Is...> {
+  typedef IndexSeq<Is...> type;
+};
+
+/**
+ * 16-bit xorshift pseudo-random number generator.
+ *
+ * Cheaper than random() on 8-bit boards, and reproducible from a seed.
+ */
+class XorShift16 {
+private:
+  uint16_t state = 1;
+public:
+  XorShift16(uint16_t seed) {
+    set_seed(seed);
+  }
+
+  void set_seed(uint16_t seed) {
+    state = seed ? seed : 1;
+  }
+
+  uint16_t next() {
+    state ^= state << 7;
+    state ^= state >> 9;
+    state ^= state << 8;
+    return state;
+  }
+
+  /** Random number in [0, n). */
+  uint16_t next(uint16_t n) {
+    return (uint32_t)next() * n >> 16;
+  }
+};
+
 class CHFilter {
 private:
   float avg_value = 0;
@@ -0,0 +1,281 @@
+/**
+ * Copyright 2025 Yat Long Poon
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Cycle-accurate profiler for the firmware, based on simavr.
+ *
+ * Runs the firmware built with SIM_PROFILE on a simulated ATmega32U4, feeds a
+ * scripted PWM waveform to the throttle channel, and reports:
+ * - cycles spent in each phase of loop(), from the PROF_* markers,
+ * - latency and duration of the throttle channel ISR,
+ * - windows with interrupts disabled, per phase.
+ *
+ * Usage: ndl-sim <firmware.elf> <waveform.txt>
+ *
+ * Each line of the waveform is "<duration in ms> <pulse width in us>", with
+ * one pulse sent every FRAME_US. Lines starting with '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/avr_ioport.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_time.h>
+
+#define MCU "atmega32u4"
+#define FREQUENCY 16000000
+
+/* Receiver frame period (in us) */
+#define FRAME_US 20000
+/* PIN_CH_THROT (pin 2 on the Pro Micro) is PD1, i.e. INT1 */
+#define THROT_PORT 'D'
+#define THROT_BIT 1
+#define THROT_VECTOR 2
+/* Number of interrupt vectors on the MCU */
+#define VECTOR_NUM 43
+/* GPIOR0 in data space, written by PROF_MARK() */
+#define MARKER_ADDR 0x3e
+
+#define MAX_SEGMENTS 256
+
+/* Phase names, in the order of PROF_* in utils.h */
+static const char* phase_names[] = {
+  "idle",
+  "loop",
+  "poll_channels",
+  "FastLED.show",
+  "fade decel",
+  "fade brake2",
+};
+#define PHASE_NUM (sizeof(phase_names) / sizeof(phase_names[0]))
+#define PHASE_ISR PHASE_NUM
+
+/* Min/max/sum of a measured quantity (in cycles) */
+struct prof_stat {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+struct segment {
+  uint32_t duration_ms;
+  uint32_t width_us;
+};
+
+static struct segment segments[MAX_SEGMENTS];
+static int segment_num = 0;
+static int segment_idx = 0;
+static uint64_t segment_end = 0;
+
+static avr_irq_t* throt_irq = NULL;
+static int throt_level = 0;
+static uint64_t edge_cycle = 0;
+static int edge_pending = 0;
+
+static unsigned phase = 0;
+static uint64_t phase_start = 0;
+static uint64_t isr_cycles = 0;
+static uint64_t loop_start = 0;
+
+static struct prof_stat phase_stats[PHASE_NUM];
+static struct prof_stat loop_busy;
+static struct prof_stat loop_period;
+static struct prof_stat isr_latency;
+static struct prof_stat isr_duration;
+static struct prof_stat cli_windows[PHASE_NUM + 1];
+
+static void stat_add(struct prof_stat* s, uint64_t v) {
+  if (s->count == 0 || v < s->min) s->min = v;
+  if (v > s->max) s->max = v;
+  s->sum += v;
+  s->count++;
+}
+
+static void stat_print(const char* name, const struct prof_stat* s) {
+  if (s->count == 0) {
+    printf("  %-16s -\n", name);
+    return;
+  }
+  printf("  %-16s n=%-8llu min=%-8llu avg=%-8llu max=%-8llu (%.1f us)\n",
+      name, (unsigned long long)s->count, (unsigned long long)s->min,
+      (unsigned long long)(s->sum / s->count), (unsigned long long)s->max,
+      s->max * 1e6 / FREQUENCY);
+}
+
+static int load_waveform(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), f) && segment_num < MAX_SEGMENTS) {
+    struct segment seg;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%u %u", &seg.duration_ms, &seg.width_us) != 2) continue;
+    segments[segment_num++] = seg;
+  }
+  fclose(f);
+  return segment_num > 0 ? 0 : -1;
+}
+
+/* Generate the PWM waveform, toggling the pin on every call. */
+static avr_cycle_count_t on_pwm_edge(avr_t* avr, avr_cycle_count_t when,
+    void* param) {
+  (void)param;
+  while (segment_idx < segment_num && when >= segment_end) {
+    segment_idx++;
+    if (segment_idx < segment_num) {
+      segment_end += avr_usec_to_cycles(avr,
+          segments[segment_idx].duration_ms * 1000);
+    }
+  }
+  if (segment_idx >= segment_num) return 0;
+
+  const uint32_t width = segments[segment_idx].width_us;
+  throt_level = !throt_level;
+  edge_cycle = avr->cycle;
+  edge_pending = 1;
+  avr_raise_irq(throt_irq, throt_level);
+  if (throt_level) return when + avr_usec_to_cycles(avr, width);
+  return when + avr_usec_to_cycles(avr, FRAME_US - width);
+}
+
+static void on_marker(avr_t* avr, avr_io_addr_t addr, uint8_t v,
+    void* param) {
+  (void)param;
+  avr->data[addr] = v;
+  if (v >= PHASE_NUM || v == phase) return;
+
+  const uint64_t now = avr->cycle;
+  stat_add(&phase_stats[phase], now - phase_start - isr_cycles);
+  if (v == 1 && phase == 0) {
+    if (loop_start) stat_add(&loop_period, now - loop_start);
+    loop_start = now;
+  } else if (v == 0 && loop_start) {
+    stat_add(&loop_busy, now - loop_start);
+  }
+  phase = v;
+  phase_start = now;
+  isr_cycles = 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <firmware.elf> <waveform.txt>\n", argv[0]);
+    return 1;
+  }
+
+  elf_firmware_t fw;
+  memset(&fw, 0, sizeof(fw));
+  if (elf_read_firmware(argv[1], &fw) != 0) {
+    fprintf(stderr, "Failed to load %s\n", argv[1]);
+    return 1;
+  }
+  if (load_waveform(argv[2]) != 0) {
+    fprintf(stderr, "No waveform in %s\n", argv[2]);
+    return 1;
+  }
+
+  avr_t* avr = avr_make_mcu_by_name(MCU);
+  if (!avr) {
+    fprintf(stderr, "Unsupported MCU %s\n", MCU);
+    return 1;
+  }
+  avr->log = LOG_ERROR;
+  avr_init(avr);
+  avr->frequency = FREQUENCY;
+  avr_load_firmware(avr, &fw);
+
+  throt_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(THROT_PORT),
+      THROT_BIT);
+  avr_raise_irq(throt_irq, 0);
+  avr_register_io_write(avr, MARKER_ADDR, on_marker, NULL);
+
+  segment_end = avr_usec_to_cycles(avr, segments[0].duration_ms * 1000);
+  avr_cycle_timer_register_usec(avr, FRAME_US, on_pwm_edge, NULL);
+
+  const avr_flashaddr_t throt_vector = THROT_VECTOR * avr->vector_size;
+  int irq_enabled = avr->sreg[S_I];
+  int in_isr = 0;
+  int is_throt_isr = 0;
+  uint64_t cli_start = 0;
+  unsigned cli_phase = 0;
+  uint64_t isr_start = 0;
+
+  int state = cpu_Running;
+  while (segment_idx < segment_num &&
+      state != cpu_Done && state != cpu_Crashed) {
+    state = avr_run(avr);
+
+    const int i_flag = avr->sreg[S_I];
+    if (irq_enabled && !i_flag) {
+      // Interrupts disabled, either by an ISR entry or by cli
+      cli_start = avr->cycle;
+      if (avr->pc < avr->vector_size * VECTOR_NUM &&
+          avr->pc % avr->vector_size == 0) {
+        in_isr = 1;
+        isr_start = avr->cycle;
+        is_throt_isr = avr->pc == throt_vector;
+        cli_phase = PHASE_ISR;
+        if (is_throt_isr && edge_pending) {
+          stat_add(&isr_latency, avr->cycle - edge_cycle);
+          edge_pending = 0;
+        }
+      } else {
+        cli_phase = phase;
+      }
+    } else if (!irq_enabled && i_flag) {
+      stat_add(&cli_windows[cli_phase], avr->cycle - cli_start);
+      if (in_isr) {
+        const uint64_t dur = avr->cycle - isr_start;
+        if (is_throt_isr) stat_add(&isr_duration, dur);
+        isr_cycles += dur;
+        in_isr = 0;
+      }
+    }
+    irq_enabled = i_flag;
+  }
+
+  if (state == cpu_Crashed) {
+    fprintf(stderr, "Firmware crashed at pc=0x%04x\n", (unsigned)avr->pc);
+    return 1;
+  }
+
+  printf("Simulated %.2f s on %s @ %d MHz\n",
+      (double)avr->cycle / FREQUENCY, MCU, FREQUENCY / 1000000);
+  printf("loop() (cycles):\n");
+  stat_print("busy", &loop_busy);
+  stat_print("period", &loop_period);
+  printf("Phases, excluding ISRs (cycles per visit):\n");
+  for (unsigned i = 1; i < PHASE_NUM; i++) {
+    stat_print(phase_names[i], &phase_stats[i]);
+  }
+  printf("Throttle ISR (cycles):\n");
+  stat_print("latency", &isr_latency);
+  stat_print("duration", &isr_duration);
+  printf("Interrupts disabled (cycles per window):\n");
+  for (unsigned i = 0; i <= PHASE_NUM; i++) {
+    stat_print(i == PHASE_ISR ? "ISRs" : phase_names[i], &cli_windows[i]);
+  }
+  return 0;
+}